@@ -1,10 +1,15 @@
 #include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <format>
+#include <iterator>
 #include <random>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <gtk4-layer-shell.h>
 #include <signal.h>
@@ -36,6 +41,12 @@ bool note_cross = false;
 
 int monitor_w, monitor_h;
 
+// Set while the window is on the bottom layer or hidden, pauses the 50ms timer and sends input region commits to a single idle callback
+bool throttled = false;
+void queue_input_region();
+void refresh_search();
+bool searching();
+
 class Imposter;
 Imposter* imposter = NULL;
 
@@ -65,6 +76,104 @@ void replace(std::string& subject, const std::string& search, const std::string&
     }
 }
 
+class Note;
+
+// Trigram index over the casefolded text of every note, kept up to date from buffer changes
+class NoteIndex
+{
+  public:
+    void update(Note* note, const char* text)
+    {
+        auto& entry = entries[note];
+        auto folded = g_utf8_casefold(text, -1);
+        entry.text = folded;
+        g_free(folded);
+        auto grams = trigrams(entry.text);
+        std::vector<uint32_t> removed;
+        std::vector<uint32_t> added;
+        std::set_difference(entry.grams.begin(), entry.grams.end(), grams.begin(), grams.end(), std::back_inserter(removed));
+        std::set_difference(grams.begin(), grams.end(), entry.grams.begin(), entry.grams.end(), std::back_inserter(added));
+        for (auto gram : removed)
+        {
+            auto it = postings.find(gram);
+            it->second.erase(note);
+            if (it->second.empty())
+                postings.erase(it);
+        }
+        for (auto gram : added)
+            postings[gram].insert(note);
+        entry.grams = std::move(grams);
+    }
+
+    void remove(Note* note)
+    {
+        auto it = entries.find(note);
+        if (it == entries.end())
+            return;
+        for (auto gram : it->second.grams)
+        {
+            auto posting = postings.find(gram);
+            posting->second.erase(note);
+            if (posting->second.empty())
+                postings.erase(posting);
+        }
+        entries.erase(it);
+    }
+
+    std::vector<Note*> search(const char* query) const
+    {
+        std::vector<Note*> matches;
+        if (!query || !*query)
+            return matches;
+        auto folded = g_utf8_casefold(query, -1);
+        std::string q(folded);
+        g_free(folded);
+        if (q.size() < 3)
+        {
+            for (auto& [note, entry] : entries)
+                if (entry.text.find(q) != std::string::npos)
+                    matches.push_back(note);
+            return matches;
+        }
+        // Only notes in the smallest posting list can match, verify those against the full query
+        const std::unordered_set<Note*>* candidates = NULL;
+        for (auto gram : trigrams(q))
+        {
+            auto it = postings.find(gram);
+            if (it == postings.end())
+                return matches;
+            if (!candidates || it->second.size() < candidates->size())
+                candidates = &it->second;
+        }
+        for (auto note : *candidates)
+            if (entries.at(note).text.find(q) != std::string::npos)
+                matches.push_back(note);
+        return matches;
+    }
+
+  private:
+    static std::vector<uint32_t> trigrams(const std::string& text)
+    {
+        std::vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= text.size(); i++)
+            grams.push_back(uint32_t(uint8_t(text[i])) << 16 | uint32_t(uint8_t(text[i + 1])) << 8 | uint8_t(text[i + 2]));
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    struct Entry
+    {
+        std::string text;
+        std::vector<uint32_t> grams;
+    };
+
+    std::unordered_map<Note*, Entry> entries;
+    std::unordered_map<uint32_t, std::unordered_set<Note*>> postings;
+};
+
+NoteIndex note_search;
+
 class Note
 {
   public:
@@ -214,11 +323,14 @@ class Note
     {
         auto note = reinterpret_cast<Note*>(data);
         note_index = 0;
+        queue_input_region();
     }
 
     static void enter(GtkEventControllerMotion* self, double x, double y, gpointer data)
     {
         auto note = reinterpret_cast<Note*>(data);
+        if (searching())
+            return;
         gtk_layer_set_keyboard_mode(note->win, GTK_LAYER_SHELL_KEYBOARD_MODE_EXCLUSIVE);
         gtk_widget_grab_focus(note->text_area);
     }
@@ -226,24 +338,29 @@ class Note
     static void leave(GtkEventControllerMotion* self, gpointer data)
     {
         auto note = reinterpret_cast<Note*>(data);
+        if (searching())
+            return;
         gtk_layer_set_keyboard_mode(note->win, GTK_LAYER_SHELL_KEYBOARD_MODE_ON_DEMAND);
         gtk_root_set_focus(GTK_ROOT(note->win), NULL);
     }
 
-    static void key_press(GtkEventControllerKey* self, guint keyval, guint keycode, GdkModifierType state, gpointer data)
+    static gboolean key_press(GtkEventControllerKey* self, guint keyval, guint keycode, GdkModifierType state, gpointer data)
     {
         auto note = reinterpret_cast<Note*>(data);
         if (keyval == GDK_KEY_Escape)
         {
             gtk_layer_set_keyboard_mode(note->win, GTK_LAYER_SHELL_KEYBOARD_MODE_ON_DEMAND);
             gtk_root_set_focus(GTK_ROOT(note->win), NULL);
+            return TRUE;
         }
         else if (keyval == GDK_KEY_q && state == GDK_CONTROL_MASK)
         {
             gtk_layer_set_keyboard_mode(note->win, GTK_LAYER_SHELL_KEYBOARD_MODE_ON_DEMAND);
             gtk_root_set_focus(GTK_ROOT(note->win), NULL);
             note->close();
+            return TRUE;
         }
+        return FALSE;
     }
 
     static void middle_press(GtkGestureClick* gesture, int n_press, double x, double y, gpointer data)
@@ -266,6 +383,19 @@ class Note
         gtk_widget_grab_focus(note->text_area);
     }
 
+    static void text_changed(GtkTextBuffer* buffer, gpointer data)
+    {
+        auto note = reinterpret_cast<Note*>(data);
+        if (note->deleted)
+            return;
+        GtkTextIter start, end;
+        gtk_text_buffer_get_bounds(buffer, &start, &end);
+        auto text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+        note_search.update(note, text);
+        g_free(text);
+        refresh_search();
+    }
+
     void close(void)
     {
         if (surface)
@@ -273,9 +403,11 @@ class Note
             cairo_surface_destroy(surface);
             surface = NULL;
         }
-        gtk_fixed_remove(GTK_FIXED(notes), frame);
         deleted = true;
+        note_search.remove(this);
+        gtk_fixed_remove(GTK_FIXED(notes), frame);
         note_index = 0;
+        queue_input_region();
     }
 
     Note(GtkWindow* win_, GtkWidget* notes_)
@@ -308,9 +440,9 @@ textview {{ color: {}; font: {}; line-height: {}; padding: 8px; background: line
         gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(text_area), GTK_WRAP_WORD_CHAR);
         gtk_widget_set_can_target(text_area, FALSE);
         gtk_text_view_set_accepts_tab(GTK_TEXT_VIEW(text_area), FALSE);
+        auto* buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_area));
         if (note_text)
         {
-            auto* buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_area));
             std::string text(note_text);
             replace(text, "\\n", "\n");
             gtk_text_buffer_set_text(buffer, text.c_str(), -1);
@@ -357,6 +489,8 @@ textview {{ color: {}; font: {}; line-height: {}; padding: 8px; background: line
         gtk_drawing_area_set_draw_func(GTK_DRAWING_AREA(drawing), draw_cb, this, NULL);
         g_signal_connect_after(drawing, "resize", G_CALLBACK(resize_cb), this);
         g_signal_connect_after(text_area, "realize", G_CALLBACK(realize), this);
+        g_signal_connect(buffer, "changed", G_CALLBACK(text_changed), this);
+        text_changed(buffer, this);
 
         gtk_layer_set_keyboard_mode(win, GTK_LAYER_SHELL_KEYBOARD_MODE_EXCLUSIVE);
         return frame;
@@ -400,22 +534,72 @@ class Imposter
         auto surf = gtk_native_get_surface(gtk_widget_get_native(GTK_WIDGET(window)));
         if (notes.empty())
         {
+            if (gtk_widget_get_visible(search))
+                reset_search();
             gtk_widget_set_visible(GTK_WIDGET(window), FALSE);
             gtk_window_set_default_size(window, -1, -1);
+            schedule();
             return;
         }
         gtk_widget_set_visible(GTK_WIDGET(window), TRUE);
+        schedule();
         std::vector<cairo_rectangle_int_t> rectv;
         for (auto n : notes)
             rectv.push_back({n->nx, n->ny, n->nw, n->nh});
+        if (gtk_widget_get_visible(search))
+        {
+            // Use the size GtkFixed will allocate, the entry may not be laid out yet when the region is committed
+            GtkRequisition req;
+            gtk_widget_get_preferred_size(search, &req, NULL);
+            rectv.push_back({search_x, search_y, req.width, req.height});
+        }
         const cairo_rectangle_int_t* rects = &rectv[0];
         auto reg = cairo_region_create_rectangles(rects, rectv.size());
         gdk_surface_set_input_region(surf, reg);
+        cairo_region_destroy(reg);
+    }
+
+    void report()
+    {
+        auto now = g_get_monotonic_time();
+        double elapsed = (now - state_since) / 1e6;
+        if (state_since && elapsed > 0)
+            g_debug("%s: %.1f callbacks/s over %.1fs", throttled ? "throttled" : "active", wakeups / elapsed, elapsed);
+        wakeups = 0;
+        state_since = now;
+    }
+
+    // Run the 50ms timer only while the notes are on the overlay layer and visible, its first tick commits the input region on resume
+    void schedule()
+    {
+        bool lowered = gtk_layer_get_layer(window) != GTK_LAYER_SHELL_LAYER_OVERLAY || !gtk_widget_get_visible(GTK_WIDGET(window));
+        if (lowered == throttled && (lowered || timer_id))
+            return;
+        report();
+        throttled = lowered;
+        if (throttled)
+        {
+            if (timer_id)
+                g_source_remove(timer_id);
+            timer_id = 0;
+            return;
+        }
+        timer_id = g_timeout_add(50, G_SOURCE_FUNC(timer), this);
+    }
+
+    static bool flush(gpointer data)
+    {
+        auto win = reinterpret_cast<Imposter*>(data);
+        win->wakeups++;
+        win->idle_id = 0;
+        win->fix_input_region();
+        return G_SOURCE_REMOVE;
     }
 
     static bool timer(gpointer data)
     {
         auto win = reinterpret_cast<Imposter*>(data);
+        win->wakeups++;
         while (note_create > 0)
         {
             win->note();
@@ -425,6 +609,90 @@ class Imposter
         return true;
     }
 
+    void open_search()
+    {
+        if (notes.empty())
+            return;
+        search_x = std::max(0, monitor_w / 2 - note_w / 2);
+        search_y = note_margin;
+        gtk_fixed_move(GTK_FIXED(fixed), search, search_x, search_y);
+        gtk_widget_insert_before(search, fixed, NULL);
+        gtk_widget_set_visible(search, TRUE);
+        gtk_layer_set_keyboard_mode(window, GTK_LAYER_SHELL_KEYBOARD_MODE_EXCLUSIVE);
+        gtk_widget_grab_focus(search);
+        highlight(gtk_editable_get_text(GTK_EDITABLE(search)));
+        fix_input_region();
+    }
+
+    void reset_search()
+    {
+        gtk_widget_set_visible(search, FALSE);
+        gtk_editable_set_text(GTK_EDITABLE(search), "");
+        highlight(NULL);
+        gtk_layer_set_keyboard_mode(window, GTK_LAYER_SHELL_KEYBOARD_MODE_ON_DEMAND);
+        gtk_root_set_focus(GTK_ROOT(window), NULL);
+    }
+
+    void close_search()
+    {
+        reset_search();
+        fix_input_region();
+    }
+
+    // Dimming is a single class on the container, only notes entering or leaving the match set are touched
+    void highlight(const char* query)
+    {
+        bool active = query && *query;
+        if (active)
+            gtk_widget_add_css_class(fixed, "searching");
+        else
+            gtk_widget_remove_css_class(fixed, "searching");
+        std::unordered_set<Note*> found;
+        for (auto n : note_search.search(query))
+            found.insert(n);
+        for (auto n : matches)
+            if (!n->deleted && !found.contains(n))
+                gtk_widget_remove_css_class(n->frame, "match");
+        for (auto n : found)
+        {
+            if (matches.contains(n))
+                continue;
+            gtk_widget_add_css_class(n->frame, "match");
+            gtk_widget_insert_before(n->frame, fixed, gtk_widget_get_visible(search) ? search : NULL);
+        }
+        matches = std::move(found);
+    }
+
+    static void search_changed(GtkSearchEntry* entry, gpointer data)
+    {
+        auto win = reinterpret_cast<Imposter*>(data);
+        win->highlight(gtk_editable_get_text(GTK_EDITABLE(entry)));
+    }
+
+    static void search_stop(GtkSearchEntry* entry, gpointer data)
+    {
+        auto win = reinterpret_cast<Imposter*>(data);
+        win->close_search();
+    }
+
+    static void search_enter(GtkEventControllerMotion* self, double x, double y, gpointer data)
+    {
+        auto win = reinterpret_cast<Imposter*>(data);
+        gtk_layer_set_keyboard_mode(win->window, GTK_LAYER_SHELL_KEYBOARD_MODE_EXCLUSIVE);
+        gtk_widget_grab_focus(win->search);
+    }
+
+    static gboolean key_press(GtkEventControllerKey* self, guint keyval, guint keycode, GdkModifierType state, gpointer data)
+    {
+        auto win = reinterpret_cast<Imposter*>(data);
+        if (keyval == GDK_KEY_f && state == GDK_CONTROL_MASK)
+        {
+            win->open_search();
+            return TRUE;
+        }
+        return FALSE;
+    }
+
     void note()
     {
         gtk_widget_set_visible(GTK_WIDGET(window), TRUE);
@@ -516,6 +784,7 @@ class Imposter
         note->set_size(note_w, note_h);
         notes.push_back(note);
         note_index++;
+        refresh_search();
         fix_input_region();
     }
 
@@ -530,6 +799,8 @@ class Imposter
         auto css = std::format(
             R""(
 window {{ background: alpha(black, 0); }}
+fixed.searching > frame {{ opacity: 0.35; }}
+fixed.searching > frame.match {{ opacity: 1; box-shadow: 0 0 6px 3px white; }}
 )"");
         gtk_css_provider_load_from_string(provider, css.c_str());
         display = gtk_widget_get_display(GTK_WIDGET(window));
@@ -563,6 +834,21 @@ window {{ background: alpha(black, 0); }}
         gtk_window_set_child(GTK_WINDOW(window), fixed);
         gtk_layer_set_keyboard_mode(window, GTK_LAYER_SHELL_KEYBOARD_MODE_EXCLUSIVE);
 
+        search = gtk_search_entry_new();
+        gtk_widget_set_size_request(search, note_w, -1);
+        gtk_widget_set_visible(search, FALSE);
+        gtk_fixed_put(GTK_FIXED(fixed), search, 0, 0);
+        g_signal_connect(search, "search-changed", G_CALLBACK(search_changed), this);
+        g_signal_connect(search, "stop-search", G_CALLBACK(search_stop), this);
+
+        auto* search_motion = gtk_event_controller_motion_new();
+        gtk_widget_add_controller(search, GTK_EVENT_CONTROLLER(search_motion));
+        g_signal_connect(search_motion, "enter", G_CALLBACK(search_enter), this);
+
+        auto* keys = gtk_event_controller_key_new();
+        gtk_widget_add_controller(GTK_WIDGET(window), GTK_EVENT_CONTROLLER(keys));
+        g_signal_connect(keys, "key-pressed", G_CALLBACK(key_press), this);
+
         if (!note_exclusive)
         {
             gtk_layer_set_anchor(window, GTK_LAYER_SHELL_EDGE_LEFT, TRUE);
@@ -589,10 +875,10 @@ window {{ background: alpha(black, 0); }}
                 gtk_layer_set_anchor(window, GTK_LAYER_SHELL_EDGE_BOTTOM, TRUE);
             }
         }
-        g_timeout_add(50, G_SOURCE_FUNC(timer), this);
         gtk_window_present(window);
         if (!note_create)
             gtk_widget_set_visible(GTK_WIDGET(window), FALSE);
+        schedule();
     }
 
     GtkApplication* app = NULL;
@@ -601,6 +887,15 @@ window {{ background: alpha(black, 0); }}
     GdkDisplay* display = NULL;
     GdkMonitor* monitor = NULL;
     GtkWidget* fixed = NULL;
+    GtkWidget* search = NULL;
+
+    int search_x = 0;
+    int search_y = 0;
+
+    guint timer_id = 0;
+    guint idle_id = 0;
+    guint wakeups = 0;
+    gint64 state_since = 0;
 
     double start_x;
     double start_y;
@@ -610,20 +905,49 @@ window {{ background: alpha(black, 0); }}
     double prev_y;
 
     std::vector<Note*> notes;
+    std::unordered_set<Note*> matches;
 };
 
-static void signal_handler(int sig)
+// Input region changes while throttled are coalesced into a single idle commit instead of waiting for the timer
+void queue_input_region()
 {
+    if (imposter && throttled && !imposter->idle_id)
+        imposter->idle_id = g_idle_add(G_SOURCE_FUNC(Imposter::flush), imposter);
+}
+
+bool searching()
+{
+    return imposter && imposter->search && gtk_widget_get_visible(imposter->search);
+}
+
+// Recompute match highlights with the current query, e.g. after a note was edited or created during a search
+void refresh_search()
+{
+    if (searching())
+        imposter->highlight(gtk_editable_get_text(GTK_EDITABLE(imposter->search)));
+}
+
+static gboolean signal_handler(gpointer data)
+{
+    int sig = GPOINTER_TO_INT(data);
     if (!imposter)
-        return;
+        return G_SOURCE_CONTINUE;
+    imposter->wakeups++;
     if (sig == SIGUSR1)
+    {
         gtk_layer_set_layer(
             imposter->window,
             gtk_layer_get_layer(imposter->window) == GTK_LAYER_SHELL_LAYER_OVERLAY ? GTK_LAYER_SHELL_LAYER_BOTTOM : GTK_LAYER_SHELL_LAYER_OVERLAY);
+        imposter->schedule();
+    }
     else if (sig == SIGUSR2)
         imposter->note();
     else if (sig == SIGTERM)
+    {
+        imposter->report();
         gtk_window_destroy(imposter->window);
+    }
+    return G_SOURCE_CONTINUE;
 }
 
 static int command_line(GApplication* app, GVariantDict* opts, void*)
@@ -639,9 +963,9 @@ static void activate(GtkApplication* app, gpointer data)
 
 int main(int argc, char* argv[])
 {
-    signal(SIGUSR1, signal_handler);
-    signal(SIGUSR2, signal_handler);
-    signal(SIGTERM, signal_handler);
+    g_unix_signal_add(SIGUSR1, signal_handler, GINT_TO_POINTER(SIGUSR1));
+    g_unix_signal_add(SIGUSR2, signal_handler, GINT_TO_POINTER(SIGUSR2));
+    g_unix_signal_add(SIGTERM, signal_handler, GINT_TO_POINTER(SIGTERM));
     GtkApplication* app = gtk_application_new(NULL, G_APPLICATION_DEFAULT_FLAGS);
 
     const GOptionEntry entries[] = {
@@ -681,6 +1005,11 @@ Controls:
   Mouse Middle                     Clear drawing / Destroy note on close button
   Escape                           Restore exclusive focus from new note
   Ctrl+Q                           Destroy focused note
+  Ctrl+F                           Search notes, Escape to close
+
+Timers are suspended while the notes are on the bottom layer or hidden.
+Run with G_MESSAGES_DEBUG=all to log how often imposter's own timer, idle and signal
+callbacks ran in each state.
 )"");
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     g_signal_connect(G_APPLICATION(app), "handle-local-options", G_CALLBACK(command_line), NULL);